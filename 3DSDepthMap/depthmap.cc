@@ -0,0 +1,243 @@
+#include "depthmap.hh"
+#include "n3dsvideo.hh"
+
+#include <cstdlib>
+#include <opencv2/opencv.hpp>
+
+#define USE_STEREO_SGBM 1
+
+// Edge detection thresholds for "deflating" the depth values. We want the colour
+// threshold to be low, and the depth threshold to be high.
+static const int COLOUR_EDGE_THRESHOLD = 5;
+static const int DEPTH_EDGE_THRESHOLD = 150;
+
+
+CameraProfile::CameraProfile() {
+	camDist = 0.035;
+	focalLen = 565.0;
+	convergence = 0.25;
+}
+
+
+DepthSettings::DepthSettings(StereoEngine engine) {
+	this->engine = engine;
+	blockSize = (engine == STEREO_BM) ? 21 : 7;
+	minDisparity = 45;
+}
+
+
+StereoEngine DepthSettings::defaultEngine() {
+#if !USE_STEREO_SGBM
+	return STEREO_BM;
+#else
+	return STEREO_SGBM;
+#endif
+}
+
+
+DepthMapper::DepthMapper(const DepthSettings& settings) : m_settings(settings) {
+	if (settings.blockSize < 1 || (settings.blockSize & 1) == 0)
+		CV_Error(cv::Error::StsBadArg, "block size must be odd");
+	if (settings.engine == STEREO_BM && (settings.blockSize < 5 || settings.blockSize > 255))
+		CV_Error(cv::Error::StsBadArg, "block size must be between 5 and 255 for StereoBM");
+
+	if (settings.engine == STEREO_BM) {
+		cv::Ptr<cv::StereoBM> matcher = cv::StereoBM::create();
+
+		// These settings were infered through trial-and-error by using a simple tool
+		// called StereoBMTunner, with sources available here:
+		// http://blog.martinperis.com/2011/08/opencv-stereo-matching.html
+
+		// The input images are NOISY - filter as much as we can.
+		matcher->setPreFilterType(cv::StereoBM::PREFILTER_XSOBEL);
+		matcher->setPreFilterCap(63);
+
+		matcher->setBlockSize(settings.blockSize);
+		matcher->setMinDisparity(settings.minDisparity);
+
+		// A larger disparity range lets us handle deeper scenes, but really crops the
+		// edges of the depth image.
+		matcher->setNumDisparities(32);
+		// This filtering step removes erratic depth values (i.e. salt-and-pepper noise).
+		// It's better to remove too much than have inaccurate values ...
+		matcher->setTextureThreshold(3000);
+		m_matcher = matcher;
+	}
+	else {
+		const int bs = settings.blockSize;
+		cv::Ptr<cv::StereoSGBM> matcher = cv::StereoSGBM::create(
+			settings.minDisparity, 32, bs, 8 * bs*bs, 32 * bs*bs);
+		// The input images are NOISY - filter as much as we can.
+		matcher->setPreFilterCap(1);
+		matcher->setUniquenessRatio(5);
+		matcher->setSpeckleWindowSize(250);
+		matcher->setSpeckleRange(1);
+		//matcher->setMode(true);
+		m_matcher = matcher;
+	}
+}
+
+
+cv::Mat DepthMapper::compute(const cv::Mat& left, const cv::Mat& right) {
+	cv::Mat disparity, tmp;
+
+	m_matcher->compute(left, right, disparity);
+	// For whatever reason, compute() gives us signed values ... likely a bug ...
+	disparity.convertTo(disparity, CV_16UC1);
+
+	// The minimum value corresponds to the "UNKNOWN" measurement.
+	double dispUnknown, dispMaxi;
+	cv::minMaxIdx(disparity, &dispUnknown, &dispMaxi);
+
+	if (m_settings.engine == STEREO_BM) {
+		//
+		// Deal with the "ballooning" effect.
+		//
+
+		cv::Mat colourEdges, disparityEdges;
+
+		// For the colour edges, blur first to remove noise.
+		cv::blur(left, tmp, cv::Size(7,7));
+		cv::Canny(tmp, colourEdges, COLOUR_EDGE_THRESHOLD, 3 * COLOUR_EDGE_THRESHOLD);
+
+		// For the disparity edges, rescale to 8-bit range, and use a slight blur.
+		double scale = 255.0 / (dispMaxi - dispUnknown + 1);
+		disparity.convertTo(tmp, CV_8U, scale, -dispUnknown * scale);
+		cv::blur(tmp, tmp, cv::Size(3, 3));
+		cv::Canny(tmp, disparityEdges, DEPTH_EDGE_THRESHOLD, 3 * DEPTH_EDGE_THRESHOLD);
+
+		//cv::imshow("colourEdges", colourEdges);
+		//cv::imshow("disparityEdges", disparityEdges);
+
+		// Search for disparity edges and force them to coincide with colour edges.
+		for (int i = 0; i < colourEdges.rows; ++i) {
+			auto *cEdgeRow = colourEdges.ptr<uchar>(i);
+			auto *dEdgeRow = disparityEdges.ptr<uchar>(i);
+			auto *dst = disparity.ptr<ushort>(i);
+
+			bool onEdge = false;
+			for (int j = 0; j < colourEdges.cols; ++j) {
+				if (!onEdge && dEdgeRow[j] > 0) {
+					if (cEdgeRow[j] == 0)
+						dst[j] = dispUnknown;
+					for (int k = j - 1; k >= 0 && dEdgeRow[k] == 0 && cEdgeRow[k] == 0; --k)
+						dst[k] = dispUnknown;
+					onEdge = true;
+				}
+				else if (onEdge && dEdgeRow[j] == 0) {
+					for (int k = j; k < colourEdges.cols && dEdgeRow[k] == 0 && cEdgeRow[k] == 0; ++k)
+						dst[k] = dispUnknown;
+					onEdge = false;
+				}
+			}
+		}
+
+		// Since we only do the above loop in 1 dimension, we may have thin lines due to noise.
+		// Remove these with a median filter (we do NOT want averages here ...)
+		cv::medianBlur(disparity, disparity, 5);
+	}
+
+	// Convert the disparity to a Kinect-style depth image. That is, we compute the depth to mm
+	// precision, then convert to some strange fixed-point format (reference: SiftFu.m:383).
+	const CameraProfile& cam = m_settings.camera;
+	for (int i = 0; i < disparity.rows; ++i) {
+		auto *row = disparity.ptr<ushort>(i);
+		for (int j = 0; j < disparity.cols; ++j) {
+			if (row[j] == dispUnknown)
+				row[j] = 0;
+			else {
+				// The disparity values are in 12:4 fixed point format, so be careful ...
+				double disp = (double)row[j] / 16.0;
+				double depth = 1000.0 * abs(
+					cam.camDist / ((cam.camDist / cam.convergence) - (disp / cam.focalLen)));
+				//printf("%f\n", depth);
+				if (depth < 65535)
+					row[j] = (ushort)depth;
+				else
+					row[j] = 0;
+				//row[j] = (d << 3) | (d >> 13); //???
+			}
+		}
+	}
+
+	return disparity;
+}
+
+
+DepthPipeline::DepthPipeline(const char *filename, const DepthSettings& settings,
+							 bool wantColour, bool wantDepth) {
+	m_video = nullptr;
+	m_rgbVideo = nullptr;
+	m_mapper = nullptr;
+	m_frameIndex = -1;
+
+	try {
+		m_video = new N3DSVideo(filename, true, true);
+		if (wantColour)
+			m_rgbVideo = new N3DSVideo(filename, false, true);
+		if (wantDepth)
+			m_mapper = new DepthMapper(settings);
+	}
+	catch (...) {
+		delete m_video;
+		delete m_rgbVideo;
+		throw;
+	}
+}
+
+
+DepthPipeline::~DepthPipeline() {
+	delete m_video;
+	delete m_rgbVideo;
+	delete m_mapper;
+}
+
+
+int DepthPipeline::width() const {
+	return m_video->width();
+}
+
+
+int DepthPipeline::height() const {
+	return m_video->height();
+}
+
+
+bool DepthPipeline::nextFrame() {
+	// Both videos decode the same packets, so they produce their stereo pairs
+	// at the same time.
+	for (;;) {
+		bool more = m_video->processStep();
+		if (more && m_rgbVideo)
+			more = m_rgbVideo->processStep();
+		if (!more)
+			return false;
+		if (m_video->hasNewStereoImage())
+			break;
+	}
+
+	++m_frameIndex;
+	if (m_mapper)
+		m_depth = m_mapper->compute(m_video->leftImage(), m_video->rightImage());
+	return true;
+}
+
+
+const cv::Mat DepthPipeline::leftImage() const {
+	return m_video->leftImage();
+}
+
+
+const cv::Mat DepthPipeline::rightImage() const {
+	return m_video->rightImage();
+}
+
+
+const cv::Mat DepthPipeline::colourLeftImage() const {
+	return m_rgbVideo ? m_rgbVideo->leftImage() : cv::Mat();
+}
+
+
+const cv::Mat DepthPipeline::colourRightImage() const {
+	return m_rgbVideo ? m_rgbVideo->rightImage() : cv::Mat();
+}
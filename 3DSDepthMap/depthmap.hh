@@ -0,0 +1,153 @@
+#ifndef DEPTH_MAP_HH
+#define DEPTH_MAP_HH
+
+#include <opencv2/core.hpp>
+#include <opencv2/calib3d.hpp>
+
+class N3DSVideo;
+
+
+/**
+	The stereo matching algorithm used to compute the disparity. The block
+	matcher additionally runs the "deflating" pass described in main.cc.
+*/
+enum StereoEngine {
+	STEREO_BM,
+	STEREO_SGBM
+};
+
+
+/**
+	Physical parameters of the stereo camera pair. The defaults describe the
+	Nintendo 3DS XL.
+*/
+struct CameraProfile {
+	// The distance between the cameras, in metres
+	double camDist;
+	// The camera focal length, in pixels
+	double focalLen;
+	// The 3DS cameras aren't perfectly aligned; the centre rays seem to converge at a
+	// point ~25cm in front of the cameras. We can still approximate the depth in this
+	// case. This value is in metres.
+	double convergence;
+
+	CameraProfile();
+};
+
+
+/**
+	Everything needed to configure a DepthMapper. Constructing an instance
+	gives the settings that have been found to work best for the given
+	engine.
+*/
+struct DepthSettings {
+	StereoEngine engine;
+	// Block size for matching. Larger is slower, and tends to be less accurate, but
+	// can find matches on less textured surfaces. MUST be odd.
+	int blockSize;
+	// The 3DS cameras are a fair distance apart, so we need a suitable minimum distance
+	// for the block matching. 48 seems good for objects that are at least 2ft from the
+	// cameras. If this is too large, then close objects won't be detected; too small and
+	// far objects won't be detected.
+	int minDisparity;
+	CameraProfile camera;
+
+	explicit DepthSettings(StereoEngine engine = defaultEngine());
+
+	static StereoEngine defaultEngine();
+};
+
+
+/**
+	Converts grayscale stereo image pairs into Kinect-style depth images (16-bit,
+	millimetres, 0 for "unknown"). Each instance owns its own matcher, so separate
+	instances can safely be used from separate threads.
+*/
+class DepthMapper {
+public:
+
+	/**
+		Creates the matcher for the given settings. Throws a cv::Exception if
+		the settings are invalid.
+	*/
+	explicit DepthMapper(const DepthSettings& settings);
+
+	const DepthSettings& settings() const { return m_settings; }
+
+	/**
+		Computes the depth image for the given left/right grayscale images. The
+		result is a freshly allocated CV_16UC1 matrix with the same size as the
+		inputs.
+	*/
+	cv::Mat compute(const cv::Mat& left, const cv::Mat& right);
+
+private:
+
+	DepthMapper(const DepthMapper&);
+	DepthMapper& operator=(const DepthMapper&);
+
+	DepthSettings m_settings;
+	cv::Ptr<cv::StereoMatcher> m_matcher;
+};
+
+
+/**
+	The complete depth pipeline for a single 3DS video: decodes the grayscale
+	stereo pairs for matching, the colour stereo pairs, and computes the depth
+	image for each pair. Like N3DSVideo, a cv::Exception is thrown if anything
+	goes wrong.
+
+	The colour pairs need a second, full decode of the video; for depth-only
+	runs, pass wantColour = false to skip it.
+*/
+class DepthPipeline {
+public:
+
+	DepthPipeline(const char *filename, const DepthSettings& settings,
+				  bool wantColour, bool wantDepth);
+	~DepthPipeline();
+
+	/**
+		The width/height of the video.
+	*/
+	int width() const;
+	int height() const;
+
+	/**
+		Decodes the video until the next stereo pair is available, and computes
+		its depth image (if wanted). Returns false once the video is exhausted.
+	*/
+	bool nextFrame();
+
+	/**
+		The index and timestamp (in milliseconds) of the current frame.
+	*/
+	int frameIndex() const { return m_frameIndex; }
+	int timeMs() const { return m_frameIndex * 50; } // 3DS video is 20fps
+
+	/**
+		The images of the current frame. The grayscale pair is always available;
+		the colour pair and depth image are empty if they were not requested.
+		Every frame gets newly allocated images, so these may be kept around
+		after calling nextFrame() again.
+	*/
+	const cv::Mat leftImage() const;
+	const cv::Mat rightImage() const;
+	const cv::Mat colourLeftImage() const;
+	const cv::Mat colourRightImage() const;
+	const cv::Mat depthImage() const { return m_depth; }
+
+private:
+
+	DepthPipeline(const DepthPipeline&);
+	DepthPipeline& operator=(const DepthPipeline&);
+
+	N3DSVideo *m_video;
+	N3DSVideo *m_rgbVideo;
+	DepthMapper *m_mapper;
+	cv::Mat m_depth;
+	int m_frameIndex;
+};
+
+
+#endif
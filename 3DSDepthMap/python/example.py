@@ -0,0 +1,96 @@
+"""
+Smoke test for the n3dsdepth module.
+
+	python example.py VIDEO.AVI [MAX_FRAMES]
+
+Iterates the clip on two threads at once (one full pipeline, one depth-only)
+and checks the array types/shapes of every frame. Then checks that an array
+stays valid after both its Frame and its Clip have been released, and that
+invalid settings are rejected.
+"""
+
+import gc
+import pathlib
+import sys
+import threading
+
+import numpy
+import n3dsdepth
+
+
+def check_frame(frame, clip, colour):
+	h, w = clip.height, clip.width
+
+	assert frame.left.dtype == numpy.uint8 and frame.left.shape == (h, w)
+	assert frame.right.dtype == numpy.uint8 and frame.right.shape == (h, w)
+	assert frame.depth.dtype == numpy.uint16 and frame.depth.shape == (h, w)
+	if colour:
+		assert frame.colour.dtype == numpy.uint8 and frame.colour.shape == (h, w, 3)
+		assert frame.colour_right.shape == (h, w, 3)
+	else:
+		assert frame.colour is None and frame.colour_right is None
+
+	# The arrays wrap the pipeline's buffers rather than owning a copy.
+	assert not frame.depth.flags.owndata and frame.depth.base is not None
+
+
+def run(path, colour, max_frames, results, key):
+	clip = n3dsdepth.Clip(path, colour=colour)
+	count = 0
+	for frame in clip:
+		assert frame.frame_index == count and frame.time_ms == 50 * count
+		check_frame(frame, clip, colour)
+		count += 1
+		if count == max_frames:
+			break
+	results[key] = count
+
+
+def main():
+	if len(sys.argv) < 2:
+		print(__doc__)
+		return 1
+	path = sys.argv[1]
+	max_frames = int(sys.argv[2]) if len(sys.argv) > 2 else 50
+
+	# Two clips in parallel; the GIL is released while each one decodes.
+	results = {}
+	threads = [
+		threading.Thread(target=run, args=(path, True, max_frames, results, "full")),
+		threading.Thread(target=run, args=(path, False, max_frames, results, "depthOnly")),
+	]
+	for t in threads:
+		t.start()
+	for t in threads:
+		t.join()
+	assert results.get("full", 0) > 0, "full pipeline produced no frames"
+	assert results.get("full") == results.get("depthOnly"), results
+	print("threads: %d frames each" % results["full"])
+
+	# An array must keep its buffer alive after the Frame and Clip are gone.
+	# This also checks that os.PathLike paths are accepted.
+	clip = n3dsdepth.Clip(pathlib.Path(path))
+	frame = next(clip)
+	depth = frame.depth
+	expected = depth.copy()
+	del frame, clip
+	gc.collect()
+	# Allocate and touch some memory so a freed buffer would likely be reused.
+	junk = [numpy.full(expected.shape, 0xffff, numpy.uint16) for _ in range(16)]
+	assert numpy.array_equal(depth, expected)
+	del junk
+	print("lifetime: ok")
+
+	# Bad settings must fail at construction, as ValueError.
+	for engine, block_size in (("sgbm", -1), ("sgbm", 4), ("bm", 3), ("bm", 257)):
+		try:
+			n3dsdepth.Clip(path, engine=engine, block_size=block_size)
+			raise AssertionError("block_size %d was accepted for %s" % (block_size, engine))
+		except ValueError:
+			pass
+	print("all checks passed")
+	return 0
+
+
+if __name__ == "__main__":
+	sys.exit(main())
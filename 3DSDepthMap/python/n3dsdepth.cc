@@ -0,0 +1,359 @@
+/**
+	Python bindings for the depth pipeline.
+
+	A Clip decodes a single 3DS video and yields one Frame per stereo pair.
+	Every image in a Frame is a NumPy array that shares its memory with the
+	cv::Mat produced by the pipeline - nothing is copied. The arrays keep the
+	underlying buffer alive, so they stay valid after the iteration moves on.
+
+	Decoding and depth computation run with the GIL released, so several clips
+	can be processed in parallel from separate Python threads:
+
+		import n3dsdepth
+		for frame in n3dsdepth.Clip("HNI_0001.AVI", engine="sgbm"):
+			frame.depth   # (h, w) uint16, millimetres, 0 = unknown
+			frame.colour  # (h, w, 3) uint8, BGR, left camera
+*/
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
+#include <numpy/arrayobject.h>
+
+#include <cassert>
+#include <cstring>
+#include <exception>
+#include <string>
+
+#include "../depthmap.hh"
+
+
+//
+// cv::Mat -> NumPy
+//
+
+static const char *MAT_CAPSULE_NAME = "n3dsdepth.Mat";
+
+static void destroyMatCapsule(PyObject *capsule) {
+	delete (cv::Mat *)PyCapsule_GetPointer(capsule, MAT_CAPSULE_NAME);
+}
+
+
+/**
+	Wraps the given matrix in a NumPy array without copying the pixel data. The
+	array holds a reference to the matrix (through a capsule as its base object),
+	so the buffer lives as long as the array does. Empty matrices become None.
+*/
+static PyObject *matToArray(const cv::Mat& mat) {
+	if (mat.empty())
+		Py_RETURN_NONE;
+
+	int type;
+	switch (mat.depth()) {
+	case CV_8U:  type = NPY_UINT8;  break;
+	case CV_16U: type = NPY_UINT16; break;
+	default:
+		PyErr_SetString(PyExc_TypeError, "unsupported matrix depth");
+		return nullptr;
+	}
+
+	const int channels = mat.channels();
+	const int nd = channels > 1 ? 3 : 2;
+	npy_intp dims[3] = { mat.rows, mat.cols, channels };
+	npy_intp strides[3] = {
+		(npy_intp)mat.step[0], (npy_intp)mat.elemSize(), (npy_intp)mat.elemSize1()
+	};
+
+	cv::Mat *owner = new cv::Mat(mat);
+	PyObject *capsule = PyCapsule_New(owner, MAT_CAPSULE_NAME, destroyMatCapsule);
+	if (capsule == nullptr) {
+		delete owner;
+		return nullptr;
+	}
+
+	PyObject *array = PyArray_New(&PyArray_Type, nd, dims, type, strides,
+								  owner->data, 0, NPY_ARRAY_WRITEABLE, nullptr);
+	if (array == nullptr) {
+		Py_DECREF(capsule);
+		return nullptr;
+	}
+	// This steals the capsule reference, even on failure.
+	if (PyArray_SetBaseObject((PyArrayObject *)array, capsule) < 0) {
+		Py_DECREF(array);
+		return nullptr;
+	}
+	return array;
+}
+
+
+//
+// Frame
+//
+
+static PyStructSequence_Field frameFields[] = {
+	{ (char *)"frame_index",  (char *)"frame number, starting at 0" },
+	{ (char *)"time_ms",      (char *)"frame timestamp in milliseconds" },
+	{ (char *)"left",         (char *)"left camera, (h, w) uint8 grayscale" },
+	{ (char *)"right",        (char *)"right camera, (h, w) uint8 grayscale" },
+	{ (char *)"colour",       (char *)"left camera, (h, w, 3) uint8 BGR, or None" },
+	{ (char *)"colour_right", (char *)"right camera, (h, w, 3) uint8 BGR, or None" },
+	{ (char *)"depth",        (char *)"depth, (h, w) uint16 millimetres (0 = unknown), or None" },
+	{ nullptr, nullptr }
+};
+
+static PyStructSequence_Desc frameDesc = {
+	(char *)"n3dsdepth.Frame",
+	(char *)"A decoded stereo pair with its colour and depth images.",
+	frameFields,
+	sizeof(frameFields) / sizeof(frameFields[0]) - 1
+};
+
+static PyTypeObject FrameType;
+
+
+static PyObject *makeFrame(const DepthPipeline& pipeline) {
+	PyObject *frame = PyStructSequence_New(&FrameType);
+	if (frame == nullptr)
+		return nullptr;
+
+	// Once an item fails, an exception is set and no further C API calls may be
+	// made. The unset items are NULL, which the struct sequence's dealloc skips.
+	PyObject *item;
+	int i = 0;
+#define SET_ITEM(expr) {									\
+		if ((item = (expr)) == nullptr) {					\
+			Py_DECREF(frame);								\
+			return nullptr;									\
+		}													\
+		PyStructSequence_SET_ITEM(frame, i++, item);		\
+	}
+	SET_ITEM(PyLong_FromLong(pipeline.frameIndex()));
+	SET_ITEM(PyLong_FromLong(pipeline.timeMs()));
+	SET_ITEM(matToArray(pipeline.leftImage()));
+	SET_ITEM(matToArray(pipeline.rightImage()));
+	SET_ITEM(matToArray(pipeline.colourLeftImage()));
+	SET_ITEM(matToArray(pipeline.colourRightImage()));
+	SET_ITEM(matToArray(pipeline.depthImage()));
+#undef SET_ITEM
+
+	// Every field in frameFields must be set above, in order.
+	assert(i == frameDesc.n_in_sequence);
+	return frame;
+}
+
+
+//
+// Clip
+//
+
+struct ClipObject {
+	PyObject_HEAD
+	DepthPipeline *pipeline;
+	// Set while a thread is inside nextFrame() with the GIL released.
+	bool busy;
+};
+
+
+static void Clip_dealloc(ClipObject *self) {
+	delete self->pipeline;
+	Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+
+static int Clip_init(ClipObject *self, PyObject *args, PyObject *kwds) {
+	static const char *kwlist[] = {
+		"path", "depth", "colour", "engine", "block_size", "min_disparity",
+		"cam_dist", "focal_length", "convergence", nullptr
+	};
+
+	PyObject *path = nullptr; // bytes, from PyUnicode_FSConverter
+	int wantDepth = 1;
+	int wantColour = 1;
+	const char *engine = nullptr;
+	int blockSize = 0;
+	DepthSettings defaults;
+	int minDisparity = defaults.minDisparity;
+	double camDist = defaults.camera.camDist;
+	double focalLen = defaults.camera.focalLen;
+	double convergence = defaults.camera.convergence;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&|ppziiddd", (char **)kwlist,
+									 PyUnicode_FSConverter, &path, &wantDepth, &wantColour, &engine,
+									 &blockSize, &minDisparity, &camDist,
+									 &focalLen, &convergence))
+		return -1;
+
+	StereoEngine stereoEngine = DepthSettings::defaultEngine();
+	if (engine != nullptr) {
+		if (strcmp(engine, "bm") == 0)
+			stereoEngine = STEREO_BM;
+		else if (strcmp(engine, "sgbm") == 0)
+			stereoEngine = STEREO_SGBM;
+		else {
+			PyErr_Format(PyExc_ValueError, "unknown engine '%s' (expected 'bm' or 'sgbm')", engine);
+			Py_DECREF(path);
+			return -1;
+		}
+	}
+
+	// Check the block size here, so a bad value fails as a ValueError at
+	// construction rather than in the matcher.
+	if (blockSize != 0 && (blockSize < 1 || (blockSize & 1) == 0)) {
+		PyErr_Format(PyExc_ValueError, "block_size must be odd and positive, or 0 for the engine default (got %d)", blockSize);
+		Py_DECREF(path);
+		return -1;
+	}
+	if (blockSize != 0 && stereoEngine == STEREO_BM && (blockSize < 5 || blockSize > 255)) {
+		PyErr_Format(PyExc_ValueError, "block_size must be between 5 and 255 for the 'bm' engine (got %d)", blockSize);
+		Py_DECREF(path);
+		return -1;
+	}
+
+	DepthSettings settings(stereoEngine);
+	if (blockSize != 0)
+		settings.blockSize = blockSize;
+	settings.minDisparity = minDisparity;
+	settings.camera.camDist = camDist;
+	settings.camera.focalLen = focalLen;
+	settings.camera.convergence = convergence;
+
+	if (self->busy) {
+		PyErr_SetString(PyExc_RuntimeError, "clip is in use by another thread");
+		Py_DECREF(path);
+		return -1;
+	}
+
+	// Opening the codecs isn't thread-safe in libavcodec, so this deliberately
+	// keeps the GIL.
+	DepthPipeline *pipeline;
+	try {
+		pipeline = new DepthPipeline(PyBytes_AS_STRING(path), settings, wantColour != 0, wantDepth != 0);
+	}
+	catch (const std::exception& ex) {
+		PyErr_SetString(PyExc_RuntimeError, ex.what());
+		Py_DECREF(path);
+		return -1;
+	}
+	Py_DECREF(path);
+
+	delete self->pipeline;
+	self->pipeline = pipeline;
+	return 0;
+}
+
+
+static PyObject *Clip_iternext(ClipObject *self) {
+	if (self->pipeline == nullptr) {
+		PyErr_SetString(PyExc_RuntimeError, "clip is not initialized");
+		return nullptr;
+	}
+	if (self->busy) {
+		PyErr_SetString(PyExc_RuntimeError, "clip is in use by another thread");
+		return nullptr;
+	}
+
+	bool gotFrame = false;
+	const char *error = nullptr;
+	std::string what;
+
+	self->busy = true;
+	Py_BEGIN_ALLOW_THREADS
+	try {
+		gotFrame = self->pipeline->nextFrame();
+	}
+	catch (const std::exception& ex) {
+		what = ex.what();
+		error = what.c_str();
+	}
+	catch (...) {
+		error = "an unknown error occured";
+	}
+	Py_END_ALLOW_THREADS
+	self->busy = false;
+
+	if (error != nullptr) {
+		PyErr_SetString(PyExc_RuntimeError, error);
+		return nullptr;
+	}
+	// Returning NULL without an exception ends the iteration.
+	if (!gotFrame)
+		return nullptr;
+	return makeFrame(*self->pipeline);
+}
+
+
+static PyObject *Clip_width(ClipObject *self, void *) {
+	if (self->pipeline == nullptr)
+		Py_RETURN_NONE;
+	return PyLong_FromLong(self->pipeline->width());
+}
+
+
+static PyObject *Clip_height(ClipObject *self, void *) {
+	if (self->pipeline == nullptr)
+		Py_RETURN_NONE;
+	return PyLong_FromLong(self->pipeline->height());
+}
+
+
+static PyGetSetDef Clip_getset[] = {
+	{ (char *)"width",  (getter)Clip_width,  nullptr, (char *)"frame width in pixels",  nullptr },
+	{ (char *)"height", (getter)Clip_height, nullptr, (char *)"frame height in pixels", nullptr },
+	{ nullptr }
+};
+
+
+static PyTypeObject ClipType = {
+	PyVarObject_HEAD_INIT(nullptr, 0)
+	"n3dsdepth.Clip",
+};
+
+
+//
+// Module
+//
+
+static PyModuleDef moduleDef = {
+	PyModuleDef_HEAD_INIT,
+	"n3dsdepth",
+	"Streams stereo, colour and depth frames from Nintendo 3DS videos as NumPy arrays.",
+	-1,
+	nullptr
+};
+
+
+PyMODINIT_FUNC PyInit_n3dsdepth() {
+	import_array();
+
+	ClipType.tp_basicsize = sizeof(ClipObject);
+	ClipType.tp_flags = Py_TPFLAGS_DEFAULT;
+	ClipType.tp_doc =
+		"Clip(path, depth=True, colour=True, engine=None, block_size=0,\n"
+		"     min_disparity=45, cam_dist=0.035, focal_length=565.0, convergence=0.25)\n\n"
+		"Iterates over the stereo pairs of a 3DS video. 'path' may be a str, bytes or\n"
+		"os.PathLike. 'engine' is 'bm' or 'sgbm'. The block size must be odd (5 to 255\n"
+		"for 'bm'); 0 uses the engine's default. Invalid settings raise ValueError.\n"
+		"Disabling 'depth' or 'colour' skips that part of the pipeline entirely.";
+	ClipType.tp_new = PyType_GenericNew;
+	ClipType.tp_init = (initproc)Clip_init;
+	ClipType.tp_dealloc = (destructor)Clip_dealloc;
+	ClipType.tp_iter = PyObject_SelfIter;
+	ClipType.tp_iternext = (iternextfunc)Clip_iternext;
+	ClipType.tp_getset = Clip_getset;
+	if (PyType_Ready(&ClipType) < 0)
+		return nullptr;
+
+	if (FrameType.tp_name == nullptr &&
+		PyStructSequence_InitType2(&FrameType, &frameDesc) < 0)
+		return nullptr;
+
+	PyObject *module = PyModule_Create(&moduleDef);
+	if (module == nullptr)
+		return nullptr;
+
+	Py_INCREF(&ClipType);
+	PyModule_AddObject(module, "Clip", (PyObject *)&ClipType);
+	Py_INCREF(&FrameType);
+	PyModule_AddObject(module, "Frame", (PyObject *)&FrameType);
+	return module;
+}
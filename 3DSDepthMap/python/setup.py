@@ -0,0 +1,76 @@
+"""
+Builds the n3dsdepth Python extension module.
+
+	python setup.py build_ext --inplace
+
+On Windows, this defaults to the bundled OpenCV/FFmpeg headers and libraries
+used by the Visual Studio project (the DLLs must be on the PATH at runtime).
+Those libraries are 32-bit and the OpenCV one is built with VS2013 (vc12), so
+they only work with a 32-bit Python. Python 3.5+ is built with VS2015 or later,
+so mixing in the vc12 C++ libraries isn't supported either. In practice, point
+the build at x64, vc14+ builds instead:
+
+	FFMPEG_DIR      FFmpeg directory with include/ and lib/
+	OPENCV_DIR      OpenCV build directory with include/ and lib/
+	OPENCV_WORLD    OpenCV library name, e.g. opencv_world3410
+
+Elsewhere, the system OpenCV and FFmpeg installations are used. N3DSVideo still uses the
+old decoding API (AVStream::codec, avcodec_decode_video2, av_free_packet,
+av_register_all), all of which were removed in FFmpeg 5.0, so this needs an
+older FFmpeg release (like the bundled 2.x one), along with OpenCV 3.x.
+
+To check the result, run example.py on a 3DS video.
+"""
+
+import os
+import sys
+from setuptools import setup, Extension
+import numpy
+
+# Paths are relative to this directory, which setuptools expects to be the
+# working directory.
+ROOT = ".."
+
+sources = [
+	"n3dsdepth.cc",
+	os.path.join(ROOT, "depthmap.cc"),
+	os.path.join(ROOT, "n3dsvideo.cc"),
+	os.path.join(ROOT, "utils.cc"),
+]
+
+include_dirs = [numpy.get_include()]
+library_dirs = []
+
+if sys.platform == "win32":
+	ffmpeg_dir = os.environ.get("FFMPEG_DIR", os.path.join(ROOT, "ffmpeg"))
+	opencv_dir = os.environ.get("OPENCV_DIR")
+	if opencv_dir:
+		opencv_include = os.path.join(opencv_dir, "include")
+		opencv_lib = os.path.join(opencv_dir, "lib")
+	else:
+		opencv_include = os.path.join(ROOT, "opencv", "include")
+		opencv_lib = os.path.join(ROOT, "opencv", "x86", "vc12", "lib")
+	include_dirs += [opencv_include, os.path.join(ffmpeg_dir, "include")]
+	library_dirs += [os.path.join(ffmpeg_dir, "lib"), opencv_lib]
+	libraries = ["avcodec", "avformat", "avutil",
+				 os.environ.get("OPENCV_WORLD", "opencv_world300")]
+	extra_compile_args = ["/EHsc"]
+else:
+	libraries = ["avcodec", "avformat", "avutil",
+				 "opencv_core", "opencv_imgproc", "opencv_imgcodecs", "opencv_calib3d"]
+	extra_compile_args = ["-std=c++11"]
+
+setup(
+	name="n3dsdepth",
+	version="0.1",
+	description="Streams stereo, colour and depth frames from Nintendo 3DS videos as NumPy arrays",
+	ext_modules=[Extension(
+		"n3dsdepth",
+		sources=sources,
+		include_dirs=include_dirs,
+		library_dirs=library_dirs,
+		libraries=libraries,
+		extra_compile_args=extra_compile_args,
+		language="c++",
+	)],
+)
@@ -1,17 +1,17 @@
 #include "utils.hh"
 #include <opencv2/opencv.hpp>
-#ifdef __linux__
-#include <unistd.h>
-#else
+#ifdef _WIN32
 #include <direct.h>
+#else
+#include <sys/stat.h>
 #endif
 
 
 void makeDirectory(const char *name) {
-#ifdef __linux__
-	mkdir(name, 0755);
-#else
+#ifdef _WIN32
 	_mkdir(name);
+#else
+	mkdir(name, 0755);
 #endif
 }
 